@@ -0,0 +1,440 @@
+//Converts a directory of OBJ models into binary models that are quick to load.
+//Each model is read, unitized, welded, optionally simplified, given facet and vertex
+//normals, optionally optimized and written out, with one model per worker thread.
+//Each binary model is read back and compared with the model that was written. A model that glm
+//cannot read or write is reported and skipped, the rest are still converted.
+
+//Number of worker threads, can be overridden on the command line.
+#define THREADS 4
+
+//Conversion constants, matching the way the animation loads its models.
+#define WELD_EPSILON 0.00001
+#define SMOOTH_ANGLE 180.0
+
+//Extensions of the models read and written.
+#define OBJ_EXTENSION ".obj"
+#define BINARY_EXTENSION ".glmb"
+
+#include "glm.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+#include <setjmp.h>
+
+//*****************************************
+//           Global Variables
+//*****************************************
+
+//Conversion stages, in the order they run.
+enum Stage {STAGE_READ, STAGE_UNITIZE, STAGE_WELD, STAGE_SIMPLIFY, STAGE_NORMALS,
+            STAGE_OPTIMIZE, STAGE_WRITE_BINARY, STAGE_VERIFY, STAGE_WRITE_OBJ, STAGES};
+const char *stageNames[STAGES] =
+  {"read", "unitize", "weld", "simplify", "normals", "optimize", "write binary", "verify",
+   "write obj"};
+
+//A model to convert, with the time spent on each stage in milliseconds.
+struct Job {
+  char input[PATH_MAX];
+  char output[PATH_MAX - 16];
+  int nameOffset;
+  double times[STAGES];
+  bool ran[STAGES];
+  GLuint verticesBefore, verticesAfter;
+  GLuint trianglesBefore, trianglesAfter;
+  const char *mismatch;
+  char error[256];
+};
+
+//Options.
+int threadCount = THREADS;
+bool optimize = false;
+float simplifyCell = 0;
+bool writeObj = false;
+
+//Work shared between the threads.
+Job *jobs = NULL;
+int jobCount = 0;
+int nextJob = 0;
+pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+
+//The job each worker is converting, and where it returns to if glm fails on it.
+thread_local Job *currentJob;
+thread_local jmp_buf jobFailed;
+
+//*****************************************
+//               Timing
+//*****************************************
+
+//Returns a monotonic time in milliseconds, which adjustments to the system clock cannot move.
+double currentTime() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+//Times a stage, from the previous call to this one.
+void finishStage(Job &job, Stage stage, double &start) {
+  double now = currentTime();
+  job.times[stage] = now - start;
+  job.ran[stage] = true;
+  start = now;
+}
+
+//*****************************************
+//              Optimize
+//*****************************************
+
+//A triangle with the material it is drawn with, for sorting.
+struct SortTriangle {
+  GLuint material, triangle;
+};
+
+int compareTriangles(const void *a, const void *b) {
+  const SortTriangle *x = (const SortTriangle *)a, *y = (const SortTriangle *)b;
+  if (x->material != y->material) return (x->material > y->material) ? 1 : -1;
+  return (x->triangle > y->triangle) - (x->triangle < y->triangle);
+}
+
+//Sorts each group's triangles by material, so glmDraw changes material and texture
+//less often, then renumbers the vertices in the order they are drawn.
+void optimizeModel(GLMmodel *model) {
+  SortTriangle *sorted = new SortTriangle[model->numtriangles];
+
+  for (GLMgroup *group = model->groups; group; group = group->next) {
+    //Material 0 on a triangle means it keeps the material before it.
+    GLuint material = group->material;
+    for (GLuint i = 0; i < group->numtriangles; i++) {
+      GLMtriangle &triangle = model->triangles[group->triangles[i]];
+      if (triangle.material) material = triangle.material;
+      triangle.material = material;
+
+      sorted[i].material = material;
+      sorted[i].triangle = group->triangles[i];
+    }
+
+    qsort(sorted, group->numtriangles, sizeof(SortTriangle), compareTriangles);
+    for (GLuint i = 0; i < group->numtriangles; i++) group->triangles[i] = sorted[i].triangle;
+  }
+
+  delete[] sorted;
+
+  //Number the vertices by first use, dropping any that are never used.
+  GLuint *remap = new GLuint[model->numvertices + 1];
+  for (GLuint i = 0; i <= model->numvertices; i++) remap[i] = 0;
+
+  GLuint numvertices = 0;
+  for (GLMgroup *group = model->groups; group; group = group->next) {
+    for (GLuint i = 0; i < group->numtriangles; i++) {
+      GLMtriangle &triangle = model->triangles[group->triangles[i]];
+      for (int j = 0; j < 3; j++) {
+        if (!remap[triangle.vindices[j]]) remap[triangle.vindices[j]] = ++numvertices;
+      }
+    }
+  }
+
+  float *vertices = new float[3 * (numvertices + 1)];
+  for (GLuint i = 1; i <= model->numvertices; i++) {
+    if (remap[i]) memcpy(&vertices[3 * remap[i]], &model->vertices[3 * i], 3 * sizeof(float));
+  }
+  memcpy(&model->vertices[3], &vertices[3], 3 * numvertices * sizeof(float));
+  model->numvertices = numvertices;
+
+  for (GLuint i = 0; i < model->numtriangles; i++) {
+    for (int j = 0; j < 3; j++) model->triangles[i].vindices[j] = remap[model->triangles[i].vindices[j]];
+  }
+
+  delete[] vertices;
+  delete[] remap;
+}
+
+//*****************************************
+//               Verify
+//*****************************************
+
+//Returns true if both arrays are missing, or both hold the same bytes.  Empty arrays
+//are read back as missing, so they match either way.
+bool sameArray(const void *a, const void *b, size_t bytes) {
+  if (!bytes) return true;
+  if (!a || !b) return a == b;
+  return !memcmp(a, b, bytes);
+}
+
+bool sameString(const char *a, const char *b) {
+  if (!a || !b) return a == b;
+  return !strcmp(a, b);
+}
+
+//Compares a model with the one read back from its binary file, returning the first part
+//that differs or NULL if they match.
+const char *compareModels(const GLMmodel *model, const GLMmodel *copy) {
+  if (copy->numvertices != model->numvertices ||
+      !sameArray(copy->vertices, model->vertices, 3 * (model->numvertices + 1) * sizeof(GLfloat)))
+    return "vertices";
+  if ((model->normals && copy->numnormals != model->numnormals) ||
+      !sameArray(copy->normals, model->normals, 3 * (model->numnormals + 1) * sizeof(GLfloat)))
+    return "normals";
+  if ((model->texcoords && copy->numtexcoords != model->numtexcoords) ||
+      !sameArray(copy->texcoords, model->texcoords, 2 * (model->numtexcoords + 1) * sizeof(GLfloat)))
+    return "texture coordinates";
+  if ((model->facetnorms && copy->numfacetnorms != model->numfacetnorms) ||
+      !sameArray(copy->facetnorms, model->facetnorms, 3 * (model->numfacetnorms + 1) * sizeof(GLfloat)))
+    return "facet normals";
+  if (copy->numtriangles != model->numtriangles ||
+      !sameArray(copy->triangles, model->triangles, model->numtriangles * sizeof(GLMtriangle)))
+    return "triangles";
+  if (memcmp(copy->position, model->position, sizeof(model->position)) ||
+      !sameString(copy->mtllibname, model->mtllibname))
+    return "header";
+
+  if (copy->nummaterials != model->nummaterials) return "materials";
+  for (GLuint i = 0; i < model->nummaterials; i++) {
+    const GLMmaterial &a = model->materials[i], &b = copy->materials[i];
+    if (!sameString(a.name, b.name) || memcmp(a.diffuse, b.diffuse, sizeof(a.diffuse)) ||
+        memcmp(a.ambient, b.ambient, sizeof(a.ambient)) ||
+        memcmp(a.specular, b.specular, sizeof(a.specular)) ||
+        a.shininess != b.shininess || a.map_diffuse != b.map_diffuse)
+      return "materials";
+  }
+
+  if (copy->numtextures != model->numtextures) return "textures";
+  for (GLuint i = 0; i < model->numtextures; i++) {
+    if (!sameString(copy->textures[i].name, model->textures[i].name)) return "textures";
+  }
+
+  if (copy->numgroups != model->numgroups) return "groups";
+  const GLMgroup *b = copy->groups;
+  for (const GLMgroup *a = model->groups; a; a = a->next, b = b->next) {
+    if (!sameString(a->name, b->name) || a->material != b->material ||
+        a->numtriangles != b->numtriangles ||
+        !sameArray(a->triangles, b->triangles, a->numtriangles * sizeof(GLuint)))
+      return "groups";
+  }
+  return NULL;
+}
+
+//*****************************************
+//               Convert
+//*****************************************
+
+void convertModel(GLMcontext &context, Job &job) {
+  double start = currentTime();
+
+  //Textures are not loaded, so no OpenGL context is needed.
+  GLMmodel *model = glmReadOBJContext(&context, job.input, GLM_NONE);
+  job.verticesBefore = model->numvertices;
+  job.trianglesBefore = model->numtriangles;
+  finishStage(job, STAGE_READ, start);
+
+  glmUnitize(model);
+  finishStage(job, STAGE_UNITIZE, start);
+
+  glmWeld(model, WELD_EPSILON);
+  finishStage(job, STAGE_WELD, start);
+
+  if (simplifyCell > 0) {
+    glmSimplify(model, simplifyCell);
+    finishStage(job, STAGE_SIMPLIFY, start);
+  }
+
+  glmFacetNormals(model);
+  glmVertexNormals(model, SMOOTH_ANGLE, GL_FALSE);
+  finishStage(job, STAGE_NORMALS, start);
+
+  if (optimize) {
+    optimizeModel(model);
+    finishStage(job, STAGE_OPTIMIZE, start);
+  }
+
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s%s", job.output, BINARY_EXTENSION);
+  glmWriteBinary(model, filename);
+  finishStage(job, STAGE_WRITE_BINARY, start);
+
+  GLMmodel *copy = glmReadBinaryContext(&context, filename, GLM_NONE);
+  job.mismatch = compareModels(model, copy);
+  glmDelete(copy);
+  finishStage(job, STAGE_VERIFY, start);
+
+  if (writeObj) {
+    snprintf(filename, sizeof(filename), "%s%s", job.output, OBJ_EXTENSION);
+    glmWriteOBJ(model, filename, GLM_SMOOTH | GLM_TEXTURE | GLM_MATERIAL);
+    finishStage(job, STAGE_WRITE_OBJ, start);
+  }
+
+  job.verticesAfter = model->numvertices;
+  job.trianglesAfter = model->numtriangles;
+  glmDelete(model);
+}
+
+void printJob(const Job &job) {
+  if (job.error[0]) {
+    printf("%s: failed, %s\n", job.input + job.nameOffset, job.error);
+    fflush(stdout);
+    return;
+  }
+
+  printf("%s: %u -> %u vertices, %u -> %u triangles\n", job.input + job.nameOffset,
+    job.verticesBefore, job.verticesAfter, job.trianglesBefore, job.trianglesAfter);
+  if (job.mismatch) printf("  binary file differs in its %s\n", job.mismatch);
+
+  for (int i = 0; i < STAGES; i++) {
+    if (job.ran[i]) printf("  %-12s %9.2f ms\n", stageNames[i], job.times[i]);
+  }
+  fflush(stdout);
+}
+
+//Called by glm instead of exiting, abandons the model so the worker moves on to the next one.
+//Whatever glm had allocated or opened for it is left behind.
+void failJob(const char *message) {
+  snprintf(currentJob->error, sizeof(currentJob->error), "%s", message);
+  char *end = currentJob->error + strlen(currentJob->error);
+  while (end > currentJob->error && end[-1] == '\n') *--end = 0;
+  longjmp(jobFailed, 1);
+}
+
+//Takes models from the shared list until there are none left.
+void *worker(void *) {
+  //Each thread loads with its own context, so nothing in glm is shared.
+  GLMcontext context;
+  glmInitContext(&context);
+
+  while (true) {
+    pthread_mutex_lock(&jobLock);
+    int index = nextJob++;
+    pthread_mutex_unlock(&jobLock);
+
+    if (index >= jobCount) return NULL;
+    currentJob = &jobs[index];
+    if (!setjmp(jobFailed)) convertModel(context, jobs[index]);
+
+    pthread_mutex_lock(&jobLock);
+    printJob(jobs[index]);
+    pthread_mutex_unlock(&jobLock);
+  }
+}
+
+//*****************************************
+//                Main
+//*****************************************
+
+//Returns true if the filename ends with the extension.
+bool hasExtension(const char *filename, const char *extension) {
+  size_t length = strlen(filename), extensionLength = strlen(extension);
+  return length > extensionLength && !strcmp(filename + length - extensionLength, extension);
+}
+
+//Makes a job for each model in the input directory.
+void findModels(const char *inputDir, const char *outputDir) {
+  DIR *dir = opendir(inputDir);
+  if (!dir) {
+    printf("Unable to read directory %s\n", inputDir);
+    exit(1);
+  }
+
+  int capacity = 0;
+  while (dirent *entry = readdir(dir)) {
+    if (!hasExtension(entry->d_name, OBJ_EXTENSION)) continue;
+
+    if (jobCount == capacity) {
+      capacity = capacity ? capacity * 2 : 16;
+      jobs = (Job *)realloc(jobs, capacity * sizeof(Job));
+    }
+
+    Job &job = jobs[jobCount++];
+    memset(&job, 0, sizeof(Job));
+    snprintf(job.input, sizeof(job.input), "%s/%s", inputDir, entry->d_name);
+    snprintf(job.output, sizeof(job.output), "%s/%s", outputDir, entry->d_name);
+    job.output[strlen(job.output) - strlen(OBJ_EXTENSION)] = '\0';
+    //An offset rather than a pointer, since the jobs array moves as it grows.
+    job.nameOffset = strlen(job.input) - strlen(entry->d_name);
+  }
+
+  closedir(dir);
+}
+
+void usage() {
+  printf("Usage: glmconvert [-j threads] [-optimize] [-simplify cell] [-obj] input_dir output_dir\n\n");
+  printf("-j         number of models converted at once (default %d)\n", THREADS);
+  printf("-optimize  sort triangles by material and renumber vertices in draw order\n");
+  printf("-simplify  merge vertices within a grid of this cell size, on the unitized model\n");
+  printf("-obj       also write an OBJ and MTL file for each model\n");
+  exit(1);
+}
+
+//Entry point.
+int main(int argc, char **argv) {
+  const char *inputDir = NULL, *outputDir = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+
+    if (!strcmp(argv[i], "-j") && hasValue) threadCount = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-optimize")) optimize = true;
+    else if (!strcmp(argv[i], "-simplify") && hasValue) simplifyCell = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-obj")) writeObj = true;
+    else if (argv[i][0] == '-') usage();
+    else if (!inputDir) inputDir = argv[i];
+    else if (!outputDir) outputDir = argv[i];
+    else usage();
+  }
+  if (!inputDir || !outputDir || threadCount < 1) usage();
+
+  //Writing OBJ files into the input directory would replace the originals.
+  char inputPath[PATH_MAX], outputPath[PATH_MAX];
+  if (mkdir(outputDir, 0755) && errno != EEXIST) {
+    printf("Unable to create directory %s\n", outputDir);
+    exit(1);
+  }
+  if (writeObj && realpath(inputDir, inputPath) && realpath(outputDir, outputPath) &&
+      !strcmp(inputPath, outputPath)) {
+    printf("The output directory must differ from the input directory when writing OBJ files\n");
+    exit(1);
+  }
+
+  findModels(inputDir, outputDir);
+  if (threadCount > jobCount) threadCount = jobCount;
+
+  glmSetFatalErrorHandler(failJob);
+
+  //Convert on the threads that could be started, or on this one if none could.
+  double start = currentTime();
+  pthread_t *threads = new pthread_t[threadCount];
+  int started = 0;
+  while (started < threadCount && !pthread_create(&threads[started], NULL, worker, NULL)) started++;
+  if (started < threadCount) {
+    printf("Unable to start %d of the threads, converting on %d\n", threadCount - started, started ? started : 1);
+    if (!started) worker(NULL);
+    threadCount = started ? started : 1;
+  }
+  for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+  double wall = currentTime() - start;
+  delete[] threads;
+
+  //Sum each stage over every model.
+  int mismatches = 0, failures = 0;
+  for (int i = 0; i < jobCount; i++) {
+    if (jobs[i].mismatch) mismatches++;
+    if (jobs[i].error[0]) failures++;
+  }
+  printf("\n%d models on %d threads in %.2f ms\n", jobCount, threadCount, wall);
+  for (int i = 0; i < STAGES; i++) {
+    double total = 0;
+    bool ran = false;
+    for (int j = 0; j < jobCount; j++) {
+      total += jobs[j].times[i];
+      ran = ran || jobs[j].ran[i];
+    }
+    if (ran) printf("  %-12s %9.2f ms\n", stageNames[i], total);
+  }
+  if (mismatches) printf("\n%d binary files differ from their models\n", mismatches);
+  if (failures) printf("\n%d models could not be converted\n", failures);
+
+  free(jobs);
+  return (mismatches || failures) ? 1 : 0;
+}
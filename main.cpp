@@ -10,12 +10,44 @@
 #define CAMERA_ELEVATION 2
 #define CAMERA_MOMENTUM 0.1
 
-//Cloud plane configuration constants.
-#define CLOUDS 12
+//Cloud field configuration constants, layers, radius and seed can be overridden on the command line.
+#define CLOUD_LAYERS 4
+#define CLOUD_RADIUS 6
+#define CLOUD_SEED 1
 #define CLOUD_SECTIONS 3
+#define CLOUD_MAX_SECTIONS 12
 #define CLOUD_INNER_PLANES 0.2
 #define CLOUD_OUTER_PLANES 0.8
 
+//Culling bounds, the radius of a tile's cloud and of the airplane and eagle's flight path.
+#define CLOUD_TILE_BOUNDS 0.5
+#define SCENE_BOUNDS 3
+
+//Texels of padding around each texture packed into the airplane's atlas.
+#define ATLAS_PADDING 16
+
+//Levels of detail each model is compiled at, the full model and two simplified ones.
+#define MODEL_DETAILS 3
+
+//Models are drawn with vertex normals and materials, the airplane with its textures too.
+#define EAGLE_MODE (GLM_SMOOTH | GLM_MATERIAL)
+#define AIRPLANE_MODE (GLM_SMOOTH | GLM_MATERIAL | GLM_TEXTURE)
+
+//Adaptive quality, lowered when the smoothed frame time goes over the target and raised when it
+//stays well under it. A raise that has to be undone waits twice as long before it is tried again.
+#define QUALITY_SMOOTHING 0.05
+#define QUALITY_LOWER_ABOVE 0.9
+#define QUALITY_RAISE_BELOW 0.5
+#define QUALITY_SETTLE_FRAMES 60
+#define QUALITY_RAISE_FRAMES 120
+#define QUALITY_MAX_RAISE_FRAMES 3840
+
+//Levels above the default best that draw finer clouds, only used when asked for on the command line.
+#define QUALITY_FINE_LEVELS 2
+
+//The free camera and the three viewpoints can be shown at once in split screen.
+#define VIEWS 4
+
 //Frame rate, lowering the frame rate may improve performance on older computers.
 #define FPS 60
 
@@ -23,6 +55,11 @@
 #define PI 3.141592
 #define SCALE_FACTOR 0.0001
 
+//Flight recorder file identification.
+#define FLIGHT_MAGIC "CFWM"
+#define FLIGHT_VERSION 2
+#define FLIGHT_ADAPTIVE 0xff
+
 //Print OpenGL errors to console if true.
 #define DEBUG false
 
@@ -31,27 +68,136 @@
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 //*****************************************
 //           Global Variables
 //*****************************************
 
-//Use glm's texture id variable to maintain consistency.
-extern GLenum _glmTextureTarget;
-
-//Models.
+//Models, with display lists of their simplified levels of detail and the textures each list binds
+//and materials it sets, which glm counts when the list is compiled rather than when it is called.
+struct ModelDetail {
+  GLuint list;
+  GLuint textureBinds, materialChanges;
+};
 GLMmodel* eagle;
 GLMmodel* airplane;
-
-//Cloud plane.
-float cloudPlaneV[CLOUDS][CLOUDS][7][CLOUD_SECTIONS][3];
+ModelDetail eagleDetails[MODEL_DETAILS], airplaneDetails[MODEL_DETAILS];
+
+//Size of the grid cells each level of detail is simplified to, in unitized model coordinates.
+float detailCells[MODEL_DETAILS] = {0, 0.02, 0.05};
+
+//Pack the airplane's textures into one, can be turned off on the command line.
+bool textureAtlas = true;
+
+//Cloud field settings.
+int cloudLayers = CLOUD_LAYERS;
+int cloudRadius = CLOUD_RADIUS;
+unsigned int cloudSeed = CLOUD_SEED;
+
+//Rendering settings that are traded for frame time, from the best quality level to the worst.
+//Each level lowers one setting, so the controller moves through them one at a time.
+struct Quality {
+  int filtering;    //0 trilinear, 1 bilinear, 2 nearest texture filtering
+  float density;    //share of the outer cloud circles that are drawn
+  int sections;     //edges of each cloud circle
+  int detail;       //model level of detail, 0 is the full model
+  float resolution; //share of the viewport's size that is rendered, then scaled up
+};
+Quality qualityLevels[] =
+  {{0, 1.00, CLOUD_MAX_SECTIONS, 0, 1.00},
+   {0, 1.00, 6,                  0, 1.00},
+   {0, 1.00, CLOUD_SECTIONS,     0, 1.00},
+   {1, 1.00, CLOUD_SECTIONS,     0, 1.00},
+   {1, 0.75, CLOUD_SECTIONS,     0, 1.00},
+   {1, 0.75, CLOUD_SECTIONS,     1, 1.00},
+   {1, 0.75, CLOUD_SECTIONS,     1, 0.85},
+   {2, 0.75, CLOUD_SECTIONS,     1, 0.85},
+   {2, 0.50, CLOUD_SECTIONS,     1, 0.85},
+   {2, 0.50, CLOUD_SECTIONS,     2, 0.85},
+   {2, 0.50, CLOUD_SECTIONS,     2, 0.70},
+   {2, 0.25, CLOUD_SECTIONS,     2, 0.70},
+   {2, 0.25, CLOUD_SECTIONS,     2, 0.50}};
+const int qualityLevelCount = sizeof(qualityLevels) / sizeof(qualityLevels[0]);
+
+//Adaptive quality state, the level can be fixed on the command line. The level starts at the
+//best one the controller may raise it to, unless one is given.
+bool adaptiveQuality = true;
+float qualityTarget = 1000.0 / FPS;
+int bestQualityLevel = QUALITY_FINE_LEVELS;
+int qualityLevel = -1;
+Quality quality;
+float smoothedFrameTime = -1;
+int qualitySettle = QUALITY_SETTLE_FRAMES;
+int raiseFrames = QUALITY_RAISE_FRAMES;
+int framesUnderTarget = 0;
+unsigned int lastChangeFrame = 0;
+bool lastChangeRaised = false;
+
+//Texture the frame is copied into when it is rendered below full resolution.
+GLuint frameTexture = 0;
+int frameTextureSize = 0;
+
+//A single cloud, shared by every tile before its seeded variation is applied.
+float cloudShape[7][CLOUD_MAX_SECTIONS][3];
+float cloudShapeT[CLOUD_MAX_SECTIONS][2];
 GLuint cloudTexture;
 
+//Cloud tiles shared by every view, one display list per tile, found by their layer and coordinates.
+//There are enough tiles for every view's field at once, so views only rebuild tiles none of them had.
+struct CloudTile {
+  int layer, x, z;
+  bool built;
+  unsigned int used;
+};
+struct CloudCache {
+  CloudTile *tiles;
+  int tileCount;
+  GLuint lists;
+  int *index;
+  int indexSize;
+  int nextReuse;
+  unsigned int stamp;
+  int viewCount;
+  bool dirty;
+};
+CloudCache cloudCache;
+
+//A visible cloud tile, ready to be drawn.
+struct CloudDraw {
+  GLuint list;
+  float x, y, z;
+};
+
 //Camera location and rotation.
-float cameraX = CAMERA_START_X * SCALE_FACTOR;
-float cameraY = CAMERA_START_Y * SCALE_FACTOR;
-float cameraZ = CAMERA_START_Z * SCALE_FACTOR;
-float cameraR = CAMERA_START_R;
+struct Camera {
+  float x, y, z, r;
+};
+Camera camera = {CAMERA_START_X * SCALE_FACTOR, CAMERA_START_Y * SCALE_FACTOR, CAMERA_START_Z * SCALE_FACTOR, CAMERA_START_R};
+
+//Viewpoints A, B and C, with the animation frame each was chosen for.
+struct Viewpoint {
+  Camera camera;
+  int frame;
+};
+Viewpoint viewpoints[3] =
+  {{{0.004524,  0.000052,  0.007764, 306}, 605},
+   {{0.000094, -0.000036, -0.000103, 42},  -1},
+   {{0.001829, -0.000004,  0.00298,  138}, 224}};
+
+//The free camera and the viewpoints, each view culls the shared cloud tiles around its own centre.
+struct View {
+  Camera camera;
+  int centerX, centerZ;
+  CloudDraw *draws;
+  int drawCount;
+  bool sceneVisible;
+};
+View views[VIEWS];
+bool splitScreen = false;
+
+int viewportX, viewportY, viewportSize;
 
 //Key event values for camera control.
 float rotationDirection = 0;
@@ -105,43 +251,126 @@ float eaglePriorX = -0.5, eaglePriorY = 0.03, eaglePriorZ = 0.1;
 float eaglePostX = 0, eaglePostY = 0, eaglePostZ = 0;
 float eagleRotX = 0, eagleRotY = 0, eagleRotZ = 0;
 
+//Centre of the airplane and eagle's flight path, for culling.
+float sceneX = 0, sceneZ = 0;
+
+//Flight recorder events, stored as type, key, frame and milliseconds since the start.
+enum FlightEventType {EVENT_KEY_DOWN, EVENT_KEY_UP, EVENT_FRAME};
+struct FlightEvent {
+  unsigned int type, key, frame, time;
+};
+
+//Flight recorder state, at most one of the files is open.
+FILE *recordFile = NULL;
+FILE *replayFile = NULL;
+unsigned int flightFrame = 0;
+double flightStart;
+FlightEvent nextEvent;
+bool hasNextEvent = false;
+
+//Settings a replayed flight was recorded with, the quality is FLIGHT_ADAPTIVE unless it was fixed.
+struct FlightSettings {
+  unsigned int seed, layers, radius, atlas, bestQuality, quality;
+};
+FlightSettings replaySettings;
+
+//Frame times measured during a replay, in milliseconds.
+float *frameTimes = NULL;
+int frameTimeCount = 0, frameTimeCapacity = 0;
+double lastFrameStart = -1;
+
+//Textures bound and materials set by glm during a replay.
+unsigned long textureBinds = 0, materialChanges = 0;
+unsigned int maxTextureBinds = 0, stateFrames = 0;
+
 //*****************************************
 //           Loading Objects
 //*****************************************
 
+//Compiles a simplified level of detail and counts the state it changes.
+void compileDetail(GLMmodel *model, ModelDetail &detail, GLuint mode, float cell) {
+  model->texturebinds = model->materialchanges = 0;
+  detail.list = glmListSimplified(model, mode, cell);
+  detail.textureBinds = model->texturebinds;
+  detail.materialChanges = model->materialchanges;
+}
+
 void loadObjects() {
-  eagle = glmReadOBJ("resources/models/eagle.obj");
+  //Share one loading context, so OpenGL is only asked for its limits once.
+  GLMcontext loader;
+  glmInitContext(&loader);
+
+  eagle = glmReadOBJContext(&loader, "resources/models/eagle.obj", GLM_TEXTURE);
   glmVertexNormals(eagle, 180.0, false);
   glmUnitize(eagle);
 
-  airplane = glmReadOBJ("resources/models/airplane.obj");
+  airplane = glmReadOBJContext(&loader, "resources/models/airplane.obj", GLM_TEXTURE);
   glmVertexNormals(airplane, 180.0, false);
   glmUnitize(airplane);
+
+  //Draw the airplane from one texture, so it binds once instead of on every texture change.
+  if (textureAtlas && !glmAtlasTextures(airplane, ATLAS_PADDING)) {
+    printf("Unable to pack the airplane's textures, drawing them separately\n");
+  }
+
+  //Compile the coarser levels of detail, the full models are drawn directly.
+  for (int i = 1; i < MODEL_DETAILS; i++) {
+    compileDetail(eagle, eagleDetails[i], EAGLE_MODE, detailCells[i]);
+    compileDetail(airplane, airplaneDetails[i], AIRPLANE_MODE, detailCells[i]);
+  }
+
+  //Compiling draws the models, which should not count towards the first frame.
+  eagle->texturebinds = eagle->materialchanges = 0;
+  airplane->texturebinds = airplane->materialchanges = 0;
+}
+
+//Sets a mipmapped texture's filtering to one of the quality levels' settings.
+void filterTexture(GLuint texture, int filtering) {
+  GLint minFilters[3] = {GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR_MIPMAP_NEAREST, GL_NEAREST_MIPMAP_NEAREST};
+  GLint magFilters[3] = {GL_LINEAR, GL_LINEAR, GL_NEAREST};
+
+  //Textures that failed to load have no id.
+  if (!texture) return;
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilters[filtering]);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilters[filtering]);
+}
+
+//Filters the cloud and model textures, the skybox is always drawn unfiltered.
+void applyTextureFiltering(int filtering) {
+  filterTexture(cloudTexture, filtering);
+  for (GLuint i = 0; i < eagle->numtextures; i++) filterTexture(eagle->textures[i].id, filtering);
+  for (GLuint i = 0; i < airplane->numtextures; i++) filterTexture(airplane->textures[i].id, filtering);
 }
 
 //*****************************************
 //               Camera
 //*****************************************
 
+//Moves the free camera, once per frame.
 void updateCamera() {
-  //Reset position and rotation.
-  glLoadIdentity();
-
   //Camera rotation.
-  cameraR += rotationDirection * CAMERA_ROTATION / FPS;
-  if (cameraR < 0) cameraR += 360;
-  if (cameraR > 360) cameraR -= 360;
+  camera.r += rotationDirection * CAMERA_ROTATION / FPS;
+  if (camera.r < 0) camera.r += 360;
+  if (camera.r > 360) camera.r -= 360;
 
   //Camera location.
   momentum += momentumDirection * CAMERA_MOMENTUM * SCALE_FACTOR / FPS;
   if (momentum < 0) momentum = 0;
-  cameraX += momentum * -sin(cameraR * PI / 180);
-  cameraY += elevationDirection * CAMERA_ELEVATION * SCALE_FACTOR / FPS;
-  cameraZ += momentum * cos(cameraR * PI / 180);
+  camera.x += momentum * -sin(camera.r * PI / 180);
+  camera.y += elevationDirection * CAMERA_ELEVATION * SCALE_FACTOR / FPS;
+  camera.z += momentum * cos(camera.r * PI / 180);
+}
+
+//Looks through a camera.
+void applyCamera(const Camera &c) {
+  //Reset position and rotation.
+  glLoadIdentity();
 
   //Move the world, not the camera.
-  glRotatef(cameraR, 0, 1, 0);
-  glTranslatef(cameraX, cameraY, cameraZ);
+  glRotatef(c.r, 0, 1, 0);
+  glTranslatef(c.x, c.y, c.z);
 }
 
 //*****************************************
@@ -158,8 +387,8 @@ void loadSkybox() {
   skybox[5] = glmLoadTexture("resources/textures/skybox/north.jpeg",  GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE, &width, &height);
 }
 
-//Draws the skybox.
-void drawSkybox() {
+//Draws the skybox around a camera.
+void drawSkybox(const Camera &c) {
   //Disable lighting, enable textures.
   glDisable(GL_LIGHTING);
   glEnableClientState(GL_TEXTURE_COORD_ARRAY);
@@ -167,9 +396,9 @@ void drawSkybox() {
   //Augment such that camera is at the center.
   GLfloat center[8][3];
   for (int i = 0; i < 8; i++) {
-    center[i][0] = vertices[i][0] - cameraX;
-    center[i][1] = vertices[i][1] - cameraY;
-    center[i][2] = vertices[i][2] - cameraZ;
+    center[i][0] = vertices[i][0] - c.x;
+    center[i][1] = vertices[i][1] - c.y;
+    center[i][2] = vertices[i][2] - c.z;
   }
 
   //Draw eace face.
@@ -200,30 +429,40 @@ void drawSkybox() {
 }
 
 //*****************************************
-//             Cloud Plane
+//             Cloud Field
 //*****************************************
 
-void calculateCloudPlane() {
+void loadCloudTexture() {
+  float width = 256, height = 256;
+  cloudTexture = glmLoadTexture("resources/textures/cloud.jpeg", GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE, &width, &height);
+}
+
+//Calculates the cloud that every tile is varied from, with the quality level's number of sections.
+void calculateCloudShape() {
+  int sections = quality.sections;
+
   //Calculate the increment.
-  float incr = 2 * PI / CLOUD_SECTIONS;
+  float incr = 2 * PI / sections;
 
   //Use cosArr and sinArr to reuse the sine and cosine calculation.
-  float cosArr[CLOUD_SECTIONS + 1], sinArr[CLOUD_SECTIONS + 1];
-  for (int i = 0; i < CLOUD_SECTIONS + 1; i++) {
+  float cosArr[CLOUD_MAX_SECTIONS + 1], sinArr[CLOUD_MAX_SECTIONS + 1];
+  for (int i = 0; i < sections + 1; i++) {
     cosArr[i] = cos(i * incr);
     sinArr[i] = sin(i * incr);
   }
 
-  //Calculate a circle.
-  float circle[CLOUD_SECTIONS][3];
-  for (int i = 0; i < CLOUD_SECTIONS; i++) {
+  //Calculate a circle and map the texture onto it.
+  float circle[CLOUD_MAX_SECTIONS][3];
+  for (int i = 0; i < sections; i++) {
     circle[i][0] = cosArr[i];
     circle[i][1] = 0;
     circle[i][2] = sinArr[i];
+
+    cloudShapeT[i][0] = 0.5 + 0.5 * cosArr[i];
+    cloudShapeT[i][1] = 0.5 + 0.5 * sinArr[i];
   }
 
   //Calculate a cloud from the circle.
-  float cloud[7][CLOUD_SECTIONS][3];
   float xScale, zScale, xTrans, zTrans;
   for (int i = 0; i < 7; i++) {
     switch (i) {
@@ -243,85 +482,293 @@ void calculateCloudPlane() {
       case 6: xScale = 0.0625; zScale = 0.0625; xTrans = 0.0625 * cos(300 * PI / 180); zTrans = 0.0625 * sin(300 * PI / 180);
       break;
     }
-    for (int j = 0; j < CLOUD_SECTIONS; j++) {
-      cloud[i][j][0] = circle[j][0] * xScale + xTrans;
-      cloud[i][j][1] = circle[j][1];
-      cloud[i][j][2] = circle[j][2] * zScale + zTrans;
+    for (int j = 0; j < sections; j++) {
+      cloudShape[i][j][0] = circle[j][0] * xScale + xTrans;
+      cloudShape[i][j][1] = circle[j][1];
+      cloudShape[i][j][2] = circle[j][2] * zScale + zTrans;
     }
   }
+}
 
-  //Calculate a cloud plane from the cloud.
-  for (int i = 0; i < CLOUDS; i++) {
-    for (int j = 0; j < CLOUDS; j++) {
-      for (int k = 0; k < 7; k++) {
-        for (int l = 0; l < CLOUD_SECTIONS; l++) {
-          cloudPlaneV[i][j][k][l][0] = cloud[k][l][0] - CLOUDS / 2 + i;
-          cloudPlaneV[i][j][k][l][1] = cloud[k][l][1];
-          cloudPlaneV[i][j][k][l][2] = cloud[k][l][2] - CLOUDS / 2 + j;
-        }
-      }
+//Allocates the shared tile cache, every tile is built the first time a view needs it.
+void configureCloudField(int layers, int radius) {
+  if (layers < 0) layers = 0;
+  if (radius < 0) radius = 0;
+  cloudLayers = layers;
+  cloudRadius = radius;
+
+  if (cloudCache.tiles) {
+    glDeleteLists(cloudCache.lists, cloudCache.tileCount);
+    delete[] cloudCache.tiles;
+    delete[] cloudCache.index;
+    for (int i = 0; i < VIEWS; i++) delete[] views[i].draws;
+  }
+
+  int width = 2 * radius;
+  int fieldCount = layers * width * width;
+  cloudCache.tileCount = fieldCount * VIEWS;
+  cloudCache.tiles = new CloudTile[cloudCache.tileCount];
+  cloudCache.lists = cloudCache.tileCount ? glGenLists(cloudCache.tileCount) : 0;
+  for (int i = 0; i < cloudCache.tileCount; i++) {
+    cloudCache.tiles[i].layer = -1;
+    cloudCache.tiles[i].built = false;
+    cloudCache.tiles[i].used = 0;
+  }
+
+  //Keep the index at most half full, counting the entries of tiles reused since it was rebuilt.
+  cloudCache.indexSize = 1;
+  while (cloudCache.indexSize < 4 * cloudCache.tileCount) cloudCache.indexSize *= 2;
+  cloudCache.index = new int[cloudCache.indexSize];
+  for (int i = 0; i < cloudCache.indexSize; i++) cloudCache.index[i] = -1;
+
+  cloudCache.nextReuse = 0;
+  cloudCache.stamp = 0;
+  cloudCache.dirty = true;
+
+  for (int i = 0; i < VIEWS; i++) {
+    views[i].draws = new CloudDraw[fieldCount];
+    views[i].drawCount = 0;
+  }
+}
+
+//Rebuilds every tile the next time it is drawn, after the cloud shape or density has changed.
+void invalidateCloudField() {
+  for (int i = 0; i < cloudCache.tileCount; i++) cloudCache.tiles[i].built = false;
+  cloudCache.dirty = true;
+}
+
+//Hashes a tile's coordinates so that the same tile always gets the same cloud.
+unsigned int cloudHash(int x, int z, int layer) {
+  unsigned int h = cloudSeed;
+  h ^= (unsigned int)x * 73856093u;
+  h ^= (unsigned int)z * 19349663u;
+  h ^= (unsigned int)layer * 83492791u;
+  h = (h ^ 61) ^ (h >> 16);
+  h *= 9;
+  h ^= h >> 4;
+  h *= 0x27d4eb2du;
+  h ^= h >> 15;
+  return h;
+}
+
+//Returns the next pseudo-random number in [0, 1) from the given state.
+float cloudRandom(unsigned int &state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return (state & 0xffffff) / (float)0x1000000;
+}
+
+//Compiles the cloud for one tile into its display list, in tile-local coordinates.
+void calculateCloudTile(int layer, int x, int z, GLuint list) {
+  unsigned int state = cloudHash(x, z, layer) | 1;
+
+  //Vary the position, size and rotation of the cloud within its tile.
+  float xJitter = (cloudRandom(state) - 0.5) * 0.5;
+  float zJitter = (cloudRandom(state) - 0.5) * 0.5;
+  float scale = 0.75 + cloudRandom(state) * 0.5;
+  float angle = cloudRandom(state) * 2 * PI;
+  float cosA = cos(angle), sinA = sin(angle);
+
+  //Lower densities drop more of the same circles, so the clouds thin out rather than change.
+  float drop = 1 - quality.density;
+
+  glNewList(list, GL_COMPILE);
+  for (int i = 0; i < 7; i++) {
+    //Always keep the centre, but drop some of the outer circles.
+    if (i > 0 && cloudRandom(state) < drop) continue;
+
+    glBegin(GL_POLYGON);
+    for (int j = 0; j < quality.sections; j++) {
+      float px = cloudShape[i][j][0] * scale;
+      float pz = cloudShape[i][j][2] * scale;
+      glTexCoord2fv(cloudShapeT[j]);
+      glVertex3f(px * cosA - pz * sinA + xJitter, cloudShape[i][j][1], px * sinA + pz * cosA + zJitter);
     }
+    glEnd();
   }
+  glEndList();
+}
 
-  //Load texture.
-  float width = 256, height = 256;
-  cloudTexture = glmLoadTexture("resources/textures/cloud.jpeg", GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE, &width, &height);
+//Returns the cached tile at a layer and coordinates, or -1.
+int findCloudTile(int layer, int x, int z) {
+  int slot = cloudHash(x, z, layer) & (cloudCache.indexSize - 1);
+
+  while (cloudCache.index[slot] >= 0) {
+    const CloudTile &tile = cloudCache.tiles[cloudCache.index[slot]];
+    if (tile.layer == layer && tile.x == x && tile.z == z) return cloudCache.index[slot];
+    slot = (slot + 1) & (cloudCache.indexSize - 1);
+  }
+  return -1;
 }
 
-//Draws 4 planes containing 'cloud' type objects with parameters defined as constants above.
-void drawCloudPlane() {
-  glPushMatrix();
-  glDisable(GL_LIGHTING);
-  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+void indexCloudTile(int tile) {
+  const CloudTile &t = cloudCache.tiles[tile];
+  int slot = cloudHash(t.x, t.z, t.layer) & (cloudCache.indexSize - 1);
 
-  //Move the plane with camera, utilises integer truncation.
-  int xOffset = -cameraX / SCALE_FACTOR;
-  float yOffset = -cameraY / SCALE_FACTOR;
-  int zOffset = -cameraZ / SCALE_FACTOR;
-  glTranslatef(xOffset, yOffset, zOffset);
+  while (cloudCache.index[slot] >= 0) slot = (slot + 1) & (cloudCache.indexSize - 1);
+  cloudCache.index[slot] = tile;
+}
 
-  //Bind data pointers.
-  glBindTexture(GL_TEXTURE_2D, cloudTexture);
-  glVertexPointer(3, GL_FLOAT, 0, cloudPlaneV);
-  glTexCoordPointer(2, GL_FLOAT, 0, texture);
+//Removes a tile from the index, moving the entries after it back into the gap unless that would
+//place them before the slot they hash to, so no search stops short of them.
+void unindexCloudTile(int tile) {
+  int mask = cloudCache.indexSize - 1;
+  const CloudTile &t = cloudCache.tiles[tile];
+  int slot = cloudHash(t.x, t.z, t.layer) & mask;
+  while (cloudCache.index[slot] != tile) slot = (slot + 1) & mask;
+
+  for (int next = (slot + 1) & mask; cloudCache.index[next] >= 0; next = (next + 1) & mask) {
+    const CloudTile &moved = cloudCache.tiles[cloudCache.index[next]];
+    int home = cloudHash(moved.x, moved.z, moved.layer) & mask;
+
+    if (((next - home) & mask) >= ((next - slot) & mask)) {
+      cloudCache.index[slot] = cloudCache.index[next];
+      slot = next;
+    }
+  }
+  cloudCache.index[slot] = -1;
+}
 
-  //Top plane.
-  glPushMatrix();
-  glTranslatef(0, CLOUD_OUTER_PLANES, 0);
-  for (int i = 0; i < CLOUDS * CLOUDS * 7; i++) {
-    glDrawArrays(GL_POLYGON, i * CLOUD_SECTIONS, CLOUD_SECTIONS);
+//Returns a tile that no view needs at the moment, there is always one as the cache holds every view's field.
+int reuseCloudTile() {
+  while (cloudCache.tiles[cloudCache.nextReuse].used == cloudCache.stamp) {
+    cloudCache.nextReuse = (cloudCache.nextReuse + 1) % cloudCache.tileCount;
   }
-  glPopMatrix();
+  return cloudCache.nextReuse;
+}
 
-  //2nd plane.
-  glPushMatrix();
-  glTranslatef(0, CLOUD_INNER_PLANES, 0);
-  for (int i = 0; i < CLOUDS * CLOUDS * 7; i++) {
-    glDrawArrays(GL_POLYGON, i * CLOUD_SECTIONS, CLOUD_SECTIONS);
+//Rebuilds the tiles that the views have just brought into range, in place of tiles that none of them need.
+void updateCloudField(int count) {
+  bool moved = cloudCache.dirty || count != cloudCache.viewCount;
+
+  for (int i = 0; i < count; i++) {
+    //Find the tile beneath the camera, utilises floor rather than truncation.
+    int centerX = floor(-views[i].camera.x / SCALE_FACTOR);
+    int centerZ = floor(-views[i].camera.z / SCALE_FACTOR);
+
+    if (centerX != views[i].centerX || centerZ != views[i].centerZ) moved = true;
+    views[i].centerX = centerX;
+    views[i].centerZ = centerZ;
   }
-  glPopMatrix();
 
-  //3rd plane.
-  glPushMatrix();
-  glTranslatef(0, -CLOUD_INNER_PLANES, 0);
-  for (int i = 0; i < CLOUDS * CLOUDS * 7; i++) {
-    glDrawArrays(GL_POLYGON, i * CLOUD_SECTIONS, CLOUD_SECTIONS);
+  if (!moved) return;
+  cloudCache.dirty = false;
+  cloudCache.viewCount = count;
+  cloudCache.stamp++;
+
+  //Mark the tiles that are already cached first, so that none of them are reused for the others.
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < count; i++) {
+      for (int layer = 0; layer < cloudLayers; layer++) {
+        for (int x = views[i].centerX - cloudRadius; x < views[i].centerX + cloudRadius; x++) {
+          for (int z = views[i].centerZ - cloudRadius; z < views[i].centerZ + cloudRadius; z++) {
+            int t = findCloudTile(layer, x, z);
+
+            if (pass == 0) {
+              if (t >= 0) cloudCache.tiles[t].used = cloudCache.stamp;
+              continue;
+            }
+
+            if (t < 0) {
+              t = reuseCloudTile();
+              CloudTile &tile = cloudCache.tiles[t];
+              if (tile.layer >= 0) unindexCloudTile(t);
+              tile.layer = layer;
+              tile.x = x;
+              tile.z = z;
+              tile.built = false;
+              indexCloudTile(t);
+            }
+
+            CloudTile &tile = cloudCache.tiles[t];
+            if (!tile.built) {
+              calculateCloudTile(layer, x, z, cloudCache.lists + t);
+              tile.built = true;
+            }
+            tile.used = cloudCache.stamp;
+          }
+        }
+      }
+    }
   }
-  glPopMatrix();
+}
 
-  //Bottom plane.
+//Returns the height of a layer. The bottom and top layers sit on the outer planes and the rest are
+//spread evenly between the inner planes, so the default four layers keep their original heights.
+float cloudLayerHeight(int layer) {
+  if (cloudLayers < 2) return 0;
+  if (layer == 0) return -CLOUD_OUTER_PLANES;
+  if (layer == cloudLayers - 1) return CLOUD_OUTER_PLANES;
+  if (cloudLayers == 3) return 0;
+  return -CLOUD_INNER_PLANES + 2 * CLOUD_INNER_PLANES * (layer - 1) / (cloudLayers - 3);
+}
+
+//Draws the cloud tiles that a view found to be visible.
+void drawCloudField(const View &view) {
   glPushMatrix();
-  glTranslatef(0, -CLOUD_OUTER_PLANES, 0);
-  for (int i = 0; i < CLOUDS * CLOUDS * 7; i++) {
-    glDrawArrays(GL_POLYGON, i * CLOUD_SECTIONS, CLOUD_SECTIONS);
+  glDisable(GL_LIGHTING);
+
+  //The layers follow the camera vertically, so it never flies through them.
+  glTranslatef(0, -view.camera.y / SCALE_FACTOR, 0);
+  glBindTexture(GL_TEXTURE_2D, cloudTexture);
+
+  for (int i = 0; i < view.drawCount; i++) {
+    const CloudDraw &draw = view.draws[i];
+
+    glPushMatrix();
+    glTranslatef(draw.x, draw.y, draw.z);
+    glCallList(draw.list);
+    glPopMatrix();
   }
-  glPopMatrix();
 
   glEnable(GL_LIGHTING);
-  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
   glPopMatrix();
 }
 
+//*****************************************
+//               Culling
+//*****************************************
+
+//Returns true if a circle on the ground plane is inside a camera's 90 degree field of view.
+//The camera only turns about the vertical axis, so the sides of the frustum are enough.
+bool inView(const Camera &c, float x, float z, float radius) {
+  float dx = x + c.x / SCALE_FACTOR;
+  float dz = z + c.z / SCALE_FACTOR;
+
+  float forward = dx * sin(c.r * PI / 180) - dz * cos(c.r * PI / 180);
+  float right = dx * cos(c.r * PI / 180) + dz * sin(c.r * PI / 180);
+
+  return forward > -radius &&
+         forward - right > -radius * sqrt(2.0) &&
+         forward + right > -radius * sqrt(2.0);
+}
+
+//Collects a view's visible cloud tiles.
+void cullView(View &view) {
+  view.drawCount = 0;
+  for (int layer = 0; layer < cloudLayers; layer++) {
+    for (int x = view.centerX - cloudRadius; x < view.centerX + cloudRadius; x++) {
+      for (int z = view.centerZ - cloudRadius; z < view.centerZ + cloudRadius; z++) {
+        if (!inView(view.camera, x, z, CLOUD_TILE_BOUNDS)) continue;
+
+        CloudDraw &draw = view.draws[view.drawCount++];
+        draw.list = cloudCache.lists + findCloudTile(layer, x, z);
+        draw.x = x;
+        draw.y = cloudLayerHeight(layer);
+        draw.z = z;
+      }
+    }
+  }
+
+  view.sceneVisible = inView(view.camera, sceneX, sceneZ, SCENE_BOUNDS);
+}
+
+//Culls each view on this thread, the tests are cheap enough that waking other threads would cost more.
+void cullViews(int count) {
+  for (int i = 0; i < count; i++) cullView(views[i]);
+}
+
 //*****************************************
 //                Lights
 //*****************************************
@@ -329,7 +776,7 @@ void drawCloudPlane() {
 //Set up lights at points on the skybox that match the textures.
 void setupLights() {
   glEnable(GL_LIGHTING);
-  glEnable(_glmTextureTarget);
+  glEnable(GL_TEXTURE_2D);
   glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
   glEnable(GL_RESCALE_NORMAL);
 
@@ -376,6 +823,19 @@ void augmentLights() {
 //              Main Scene
 //*****************************************
 
+//Draws a model at the quality level's detail, the full model is drawn without a display list.
+void drawModel(GLMmodel *model, const ModelDetail *details, GLuint mode) {
+  if (quality.detail == 0) {
+    glmDraw(model, mode);
+    return;
+  }
+
+  const ModelDetail &detail = details[quality.detail];
+  glCallList(detail.list);
+  model->texturebinds += detail.textureBinds;
+  model->materialchanges += detail.materialChanges;
+}
+
 void drawEagle() {
   glPushMatrix();
 
@@ -385,7 +845,7 @@ void drawEagle() {
   //Face forward.
   glRotatef(180, 0, 1, 0);
 
-  glmDraw(eagle, GLM_SMOOTH | GLM_MATERIAL);
+  drawModel(eagle, eagleDetails, EAGLE_MODE);
 
   glPopMatrix();
 }
@@ -397,7 +857,7 @@ void drawAirplane() {
   glRotatef(270, 1, 0, 0);
   glRotatef(90, 0, 0, 1);
 
-  glmDraw(airplane, GLM_SMOOTH | GLM_MATERIAL | GLM_TEXTURE);
+  drawModel(airplane, airplaneDetails, AIRPLANE_MODE);
 
   glPopMatrix();
 }
@@ -408,9 +868,8 @@ void bounds(float &angle) {
   if (angle < 0) angle += 360;
 }
 
-void drawScene() {
-  glPushMatrix();
-
+//Advances the animation, once per frame however many views draw it.
+void updateScene() {
   //Set the animation control variables.
   if (!paused) frame++;
   int ticks = frame % 1440;
@@ -427,10 +886,6 @@ void drawScene() {
     eagleRotX = 0, eagleRotY = 0, eagleRotZ = 0;
   }
 
-  //Apply scene transformations.
-  glRotatef(30, 0, 1, 0);
-  glTranslatef(0, 0, -1500 * frame * SCALE_FACTOR);
-
   //Make sure angles are in bounds.
   bounds(planeRotX); bounds(planeRotY); bounds(planeRotZ);
   bounds(eagleRotX); bounds(eagleRotY); bounds(eagleRotZ);
@@ -517,6 +972,18 @@ void drawScene() {
     if (ticks >= 1420 && ticks < 1440) eaglePriorY -= 0.01;
   }
 
+  //Find where the scene transformations move the airplane and eagle to.
+  sceneX = -1500 * frame * SCALE_FACTOR * sin(30 * PI / 180);
+  sceneZ = -1500 * frame * SCALE_FACTOR * cos(30 * PI / 180);
+}
+
+void drawScene() {
+  glPushMatrix();
+
+  //Apply scene transformations.
+  glRotatef(30, 0, 1, 0);
+  glTranslatef(0, 0, -1500 * frame * SCALE_FACTOR);
+
   //Apply the transformations then draw the airplane.
   glPushMatrix();
   glTranslatef(planePriorX, planePriorY, planePriorZ);
@@ -539,14 +1006,406 @@ void drawScene() {
   glPopMatrix();
 }
 
+//*****************************************
+//                Views
+//*****************************************
+
+//Moves the viewpoints along with the scene, so each keeps the view it was chosen for.
+void updateViews() {
+  views[0].camera = camera;
+
+  for (int i = 1; i < VIEWS; i++) {
+    const Viewpoint &viewpoint = viewpoints[i - 1];
+    float travel = -1500 * (frame - viewpoint.frame) * SCALE_FACTOR * SCALE_FACTOR;
+
+    views[i].camera = viewpoint.camera;
+    views[i].camera.x -= travel * sin(30 * PI / 180);
+    views[i].camera.z -= travel * cos(30 * PI / 180);
+  }
+}
+
+//Draws a view into its part of a square of the given size at the viewport's bottom left corner,
+//the scene was already updated and culled.
+void drawView(const View &view, int index, int count, int size) {
+  if (count == 1) {
+    glViewport(viewportX, viewportY, size, size);
+  }
+  else {
+    //Split the square into a grid, filled from the top left.
+    int half = size / 2;
+    glViewport(viewportX + (index % 2) * half, viewportY + (1 - index / 2) * half, half, half);
+  }
+
+  //Augment camera, draw skybox.
+  applyCamera(view.camera);
+  drawSkybox(view.camera);
+
+  //Scale the world and reset light positions.
+  glScalef(SCALE_FACTOR, SCALE_FACTOR, SCALE_FACTOR);
+  augmentLights();
+
+  //Draw the clouds and the main scene.
+  drawCloudField(view);
+  if (view.sceneVisible) drawScene();
+}
+
+//Stretches a frame drawn at a lower resolution in the viewport's bottom left corner over the whole viewport.
+void upscaleFrame(int size) {
+  //Grow the texture to the power of two that holds the viewport, older hardware needs one.
+  if (frameTextureSize < viewportSize) {
+    if (!frameTexture) glGenTextures(1, &frameTexture);
+    frameTextureSize = 1;
+    while (frameTextureSize < viewportSize) frameTextureSize *= 2;
+
+    glBindTexture(GL_TEXTURE_2D, frameTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, frameTextureSize, frameTextureSize, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, frameTexture);
+  glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewportX, viewportY, size, size);
+
+  //Draw it as a single quad in front of everything, unlit.
+  glViewport(viewportX, viewportY, viewportSize, viewportSize);
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glMatrixMode(GL_MODELVIEW);
+  glLoadIdentity();
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_LIGHTING);
+
+  float edge = (float)size / frameTextureSize;
+  glBegin(GL_QUADS);
+  glTexCoord2f(0, 0);       glVertex2f(-1, -1);
+  glTexCoord2f(edge, 0);    glVertex2f(+1, -1);
+  glTexCoord2f(edge, edge); glVertex2f(+1, +1);
+  glTexCoord2f(0, edge);    glVertex2f(-1, +1);
+  glEnd();
+
+  glEnable(GL_LIGHTING);
+  glEnable(GL_DEPTH_TEST);
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+}
+
+//*****************************************
+//            Flight Recorder
+//*****************************************
+
+//Key handlers are defined with the other GLUT callbacks.
+void keyDown(unsigned char key, int x, int y);
+void keyUp(unsigned char key, int x, int y);
+
+//Returns a monotonic time in milliseconds, which adjustments to the system clock cannot move.
+double currentTime() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+//Writes an integer as little-endian bytes, so recordings move between machines.
+void writeUInt(FILE *file, unsigned int value, int bytes) {
+  for (int i = 0; i < bytes; i++) fputc((value >> (8 * i)) & 0xff, file);
+}
+
+bool readUInt(FILE *file, unsigned int &value, int bytes) {
+  value = 0;
+  for (int i = 0; i < bytes; i++) {
+    int c = fgetc(file);
+    if (c == EOF) return false;
+    value |= (unsigned int)c << (8 * i);
+  }
+  return true;
+}
+
+//Only one flight can be recorded or replayed at a time, a replay would otherwise be recorded too.
+void checkNoFlight(const char *option) {
+  if (!recordFile && !replayFile) return;
+
+  printf("Usage: %s cannot be combined with another -record or -replay\n", option);
+  exit(1);
+}
+
+void startRecording(const char *filename) {
+  checkNoFlight("-record");
+  recordFile = fopen(filename, "wb");
+  if (!recordFile) {
+    printf("Unable to record flight to %s\n", filename);
+    exit(1);
+  }
+
+  fputs(FLIGHT_MAGIC, recordFile);
+  writeUInt(recordFile, FLIGHT_VERSION, 1);
+  flightStart = currentTime();
+}
+
+//Appends an event to the recording, tagged with the frame it applies to.
+void recordEvent(FlightEventType type, unsigned char key) {
+  if (!recordFile) return;
+
+  writeUInt(recordFile, type, 1);
+  writeUInt(recordFile, key, 1);
+  writeUInt(recordFile, flightFrame, 4);
+  writeUInt(recordFile, currentTime() - flightStart, 4);
+}
+
+bool readEvent(FlightEvent &event) {
+  return readUInt(replayFile, event.type, 1) &&
+         readUInt(replayFile, event.key, 1) &&
+         readUInt(replayFile, event.frame, 4) &&
+         readUInt(replayFile, event.time, 4);
+}
+
+void startReplay(const char *filename) {
+  checkNoFlight("-replay");
+  replayFile = fopen(filename, "rb");
+  if (!replayFile) {
+    printf("Unable to replay flight from %s\n", filename);
+    exit(1);
+  }
+
+  char magic[4];
+  unsigned int version;
+  FlightSettings &s = replaySettings;
+  if (fread(magic, 1, 4, replayFile) != 4 || strncmp(magic, FLIGHT_MAGIC, 4) ||
+      !readUInt(replayFile, version, 1) || version != FLIGHT_VERSION ||
+      !readUInt(replayFile, s.seed, 4) || !readUInt(replayFile, s.layers, 4) ||
+      !readUInt(replayFile, s.radius, 4) || !readUInt(replayFile, s.atlas, 1) ||
+      !readUInt(replayFile, s.bestQuality, 1) || !readUInt(replayFile, s.quality, 1)) {
+    printf("%s is not a flight recording, or was recorded by another version\n", filename);
+    exit(1);
+  }
+
+  hasNextEvent = readEvent(nextEvent);
+}
+
+//Stores the settings that change what is drawn, once the command line has been read.
+void writeFlightSettings() {
+  if (!recordFile) return;
+
+  writeUInt(recordFile, cloudSeed, 4);
+  writeUInt(recordFile, cloudLayers, 4);
+  writeUInt(recordFile, cloudRadius, 4);
+  writeUInt(recordFile, textureAtlas, 1);
+  writeUInt(recordFile, bestQualityLevel, 1);
+  writeUInt(recordFile, adaptiveQuality ? FLIGHT_ADAPTIVE : qualityLevel, 1);
+}
+
+//Replays a flight with the settings it was recorded with. Other clouds would make it another flight,
+//so they are refused, but the atlas and quality level can be changed to compare them on the same flight.
+void applyFlightSettings() {
+  if (!replayFile) return;
+  const FlightSettings &s = replaySettings;
+
+  if (s.seed != cloudSeed || s.layers != (unsigned int)cloudLayers ||
+      s.radius != (unsigned int)cloudRadius || s.bestQuality != (unsigned int)bestQualityLevel) {
+    printf("Usage: the flight was recorded with -seed %u -layers %d -radius %d%s, replay it with the same\n",
+      s.seed, (int)s.layers, (int)s.radius, s.bestQuality ? "" : " -fineclouds");
+    exit(1);
+  }
+
+  if (s.atlas && !textureAtlas) printf("Replaying with -noatlas, the flight was recorded with the atlas\n");
+  if (!s.atlas) textureAtlas = false;
+
+  if (s.quality == FLIGHT_ADAPTIVE) return;
+  if (qualityLevel < 0) qualityLevel = s.quality;
+  else if (qualityLevel != (int)s.quality) printf("Replaying at quality level %d, the flight was recorded at level %u\n", qualityLevel, s.quality);
+}
+
+//Sorting comparison for frame times.
+int compareFrameTimes(const void *a, const void *b) {
+  float x = *(const float *)a, y = *(const float *)b;
+  return (x > y) - (x < y);
+}
+
+//Stores the time since the previous frame started.
+void measureFrameTime() {
+  double now = currentTime();
+
+  if (lastFrameStart >= 0) {
+    if (frameTimeCount == frameTimeCapacity) {
+      frameTimeCapacity = frameTimeCapacity ? frameTimeCapacity * 2 : 1024;
+      frameTimes = (float *)realloc(frameTimes, frameTimeCapacity * sizeof(float));
+    }
+    frameTimes[frameTimeCount++] = now - lastFrameStart;
+  }
+
+  lastFrameStart = now;
+}
+
+//Counts the textures bound and materials set while drawing the models this frame.
+void measureStateChanges() {
+  unsigned int binds = airplane->texturebinds + eagle->texturebinds;
+
+  textureBinds += binds;
+  materialChanges += airplane->materialchanges + eagle->materialchanges;
+  if (binds > maxTextureBinds) maxTextureBinds = binds;
+  stateFrames++;
+
+  airplane->texturebinds = airplane->materialchanges = 0;
+  eagle->texturebinds = eagle->materialchanges = 0;
+}
+
+//Prints the frame time statistics and quits.
+void finishReplay() {
+  if (frameTimeCount == 0) {
+    printf("Replayed %u frames, too few to measure\n", flightFrame);
+    exit(0);
+  }
+
+  float total = 0;
+  for (int i = 0; i < frameTimeCount; i++) total += frameTimes[i];
+  qsort(frameTimes, frameTimeCount, sizeof(float), compareFrameTimes);
+
+  int p99 = (frameTimeCount - 1) * 99 / 100;
+  printf("Replayed %u frames\n", flightFrame);
+  printf("Frame time (ms): min %.2f, avg %.2f, p99 %.2f\n",
+    frameTimes[0], total / frameTimeCount, frameTimes[p99]);
+  printf("Texture binds per frame: avg %.2f, max %u\n",
+    (float)textureBinds / stateFrames, maxTextureBinds);
+  printf("Material changes per frame: avg %.2f\n", (float)materialChanges / stateFrames);
+
+  exit(0);
+}
+
+//Applies the recorded events for the frame about to be drawn.
+void replayEvents() {
+  if (!hasNextEvent) finishReplay();
+
+  while (hasNextEvent && nextEvent.frame == flightFrame) {
+    if (nextEvent.type == EVENT_KEY_DOWN) keyDown(nextEvent.key, 0, 0);
+    if (nextEvent.type == EVENT_KEY_UP) keyUp(nextEvent.key, 0, 0);
+    hasNextEvent = readEvent(nextEvent);
+  }
+}
+
+//*****************************************
+//            Adaptive Quality
+//*****************************************
+
+//Moves to a neighbouring quality level, then logs the settings that changed and why.
+void changeQuality(int level, const char *reason) {
+  const char *filters[3] = {"trilinear", "bilinear", "nearest"};
+  Quality from = quality, to = qualityLevels[level];
+
+  printf("Quality level %d -> %d,", qualityLevel, level);
+  if (from.filtering != to.filtering) printf(" texture filtering %s -> %s,", filters[from.filtering], filters[to.filtering]);
+  if (from.density != to.density) printf(" cloud density %.0f%% -> %.0f%%,", from.density * 100, to.density * 100);
+  if (from.sections != to.sections) printf(" cloud sections %d -> %d,", from.sections, to.sections);
+  if (from.detail != to.detail) printf(" model detail %d -> %d,", from.detail, to.detail);
+  if (from.resolution != to.resolution) printf(" resolution %.0f%% -> %.0f%%,", from.resolution * 100, to.resolution * 100);
+  printf(" as %s\n", reason);
+  fflush(stdout);
+
+  lastChangeRaised = level < qualityLevel;
+  lastChangeFrame = flightFrame;
+  qualityLevel = level;
+  quality = to;
+  qualitySettle = QUALITY_SETTLE_FRAMES;
+  framesUnderTarget = 0;
+
+  //Detail and resolution are read as each frame is drawn, the rest has to be rebuilt.
+  if (from.filtering != to.filtering) applyTextureFiltering(to.filtering);
+  if (from.sections != to.sections) calculateCloudShape();
+  if (from.sections != to.sections || from.density != to.density) invalidateCloudField();
+}
+
+//Smooths the time taken to draw each frame, and lowers the quality as soon as it goes over the
+//target, but only raises it once it has stayed well under the target for a while.
+void adaptQuality(float frameTime) {
+  if (smoothedFrameTime < 0) smoothedFrameTime = frameTime;
+  smoothedFrameTime += (frameTime - smoothedFrameTime) * QUALITY_SMOOTHING;
+
+  //Let the smoothed time catch up with the last change before making another.
+  if (qualitySettle > 0) {
+    qualitySettle--;
+    return;
+  }
+
+  float lowerAbove = qualityTarget * QUALITY_LOWER_ABOVE;
+  float raiseBelow = qualityTarget * QUALITY_RAISE_BELOW;
+  char reason[128];
+
+  if (smoothedFrameTime > lowerAbove && qualityLevel < qualityLevelCount - 1) {
+    //Undoing a raise means the level above is out of reach for now, so wait longer to try it again.
+    if (lastChangeRaised && flightFrame - lastChangeFrame < QUALITY_SETTLE_FRAMES + QUALITY_RAISE_FRAMES) {
+      raiseFrames *= 2;
+      if (raiseFrames > QUALITY_MAX_RAISE_FRAMES) raiseFrames = QUALITY_MAX_RAISE_FRAMES;
+    }
+
+    snprintf(reason, sizeof(reason), "the frame time of %.2f ms is over %.2f ms", smoothedFrameTime, lowerAbove);
+    changeQuality(qualityLevel + 1, reason);
+  }
+  else if (smoothedFrameTime < raiseBelow && qualityLevel > bestQualityLevel) {
+    if (++framesUnderTarget < raiseFrames) return;
+
+    //The previous raise held, so the next one need not wait as long.
+    if (lastChangeRaised) raiseFrames = QUALITY_RAISE_FRAMES;
+
+    snprintf(reason, sizeof(reason), "the frame time of %.2f ms has been under %.2f ms for %d frames",
+      smoothedFrameTime, raiseBelow, framesUnderTarget);
+    changeQuality(qualityLevel - 1, reason);
+  }
+  else {
+    framesUnderTarget = 0;
+  }
+}
+
 //*****************************************
 //                 GLUT
 //*****************************************
 
+//Reads the options left over once GLUT has taken its own.
+void parseArguments(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+
+    if (!strcmp(argv[i], "-layers") && hasValue) cloudLayers = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-radius") && hasValue) cloudRadius = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-seed") && hasValue) cloudSeed = strtoul(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "-record") && hasValue) startRecording(argv[++i]);
+    else if (!strcmp(argv[i], "-replay") && hasValue) startReplay(argv[++i]);
+    else if (!strcmp(argv[i], "-noatlas")) textureAtlas = false;
+    else if (!strcmp(argv[i], "-target") && hasValue) {
+      char *end;
+      qualityTarget = strtod(argv[++i], &end);
+      if (*end || !(qualityTarget > 0)) {
+        printf("Usage: -target takes a frame time in milliseconds greater than 0, not %s\n", argv[i]);
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "-fineclouds")) bestQualityLevel = 0;
+    else if (!strcmp(argv[i], "-quality") && hasValue) {
+      char *end;
+      qualityLevel = strtol(argv[++i], &end, 10);
+      if (*end || end == argv[i] || qualityLevel < 0 || qualityLevel >= qualityLevelCount) {
+        printf("Usage: -quality takes a level from 0 to %d, not %s\n", qualityLevelCount - 1, argv[i]);
+        exit(1);
+      }
+      adaptiveQuality = false;
+    }
+    else printf("Ignoring unknown option: %s\n", argv[i]);
+  }
+}
+
 //Initialisation function.
 void init(int argc, char **argv) {
   //Initialise GLUT.
   glutInit(&argc, argv);
+  parseArguments(argc, argv);
+  applyFlightSettings();
+
+  //Replays measure a fixed amount of work, so the quality only adapts during live flights.
+  if (replayFile) adaptiveQuality = false;
+  if (qualityLevel < 0) qualityLevel = bestQualityLevel;
+  if (qualityLevel >= qualityLevelCount) qualityLevel = qualityLevelCount - 1;
+  quality = qualityLevels[qualityLevel];
+  writeFlightSettings();
 
   // Use doule buffering.
   glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
@@ -578,34 +1437,62 @@ void init(int argc, char **argv) {
   loadSkybox();
   loadObjects();
 
-  //Calculate cloud plane.
-  calculateCloudPlane();
+  //Calculate the cloud and allocate the cloud field.
+  loadCloudTexture();
+  calculateCloudShape();
+  configureCloudField(cloudLayers, cloudRadius);
+  applyTextureFiltering(quality.filtering);
 }
 
+//Keeps the largest centred square, the views are drawn inside it.
 void reshape(int width, int height) {
   int min = (width > height) ? height : width;
-  glViewport((width - min) / 2, (height - min) / 2, min, min);
+  viewportX = (width - min) / 2;
+  viewportY = (height - min) / 2;
+  viewportSize = min;
 }
 
 //Main display loop.
 void display() {
+  //Time the frame and apply its input when replaying a flight.
+  if (replayFile) {
+    measureFrameTime();
+    replayEvents();
+  }
+
+  double frameStart = currentTime();
+
   //Clear buffers.
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-  //Augment camera, draw skybox.
+  //Animate once, then rebuild and cull the clouds for each view.
+  int count = splitScreen ? VIEWS : 1;
   updateCamera();
-  drawSkybox();
-
-  //Scale the world and reset light positions.
-  glScalef(SCALE_FACTOR, SCALE_FACTOR, SCALE_FACTOR);
-  augmentLights();
-
-  //Draw the plane containing clouds and the main scene.
-  drawCloudPlane();
-  drawScene();
+  updateScene();
+  updateViews();
+  updateCloudField(count);
+  cullViews(count);
+
+  //Draw each view, at a lower resolution if the quality level asks for one.
+  int size = viewportSize * quality.resolution;
+  for (int i = 0; i < count; i++) drawView(views[i], i, count, size);
+  if (size < viewportSize) upscaleFrame(size);
+  if (replayFile) measureStateChanges();
+
+  //Time the frame up to the swap, which also waits for the vertical blank and would otherwise
+  //make a frame that easily fits count as a whole refresh. Finishing first includes the graphics
+  //card's share, at the cost of preparing the next frame while it draws.
+  if (adaptiveQuality) {
+    glFinish();
+    adaptQuality(currentTime() - frameStart);
+  }
 
   //Swap buffers.
   glutSwapBuffers();
+
+  //Mark the end of the frame in the recording.
+  recordEvent(EVENT_FRAME, 0);
+  flightFrame++;
 }
 
 void timer(int n) {
@@ -622,7 +1509,9 @@ void timer(int n) {
   }
 
   glutPostRedisplay();
-  glutTimerFunc(1000 / FPS, timer, 0);
+
+  //Replays run as fast as possible to measure the renderer.
+  glutTimerFunc(replayFile ? 0 : 1000 / FPS, timer, 0);
 }
 
 void keyDown(unsigned char key, int x, int y) {
@@ -653,10 +1542,10 @@ void keyDown(unsigned char key, int x, int y) {
 
     case 'r':
       //Reset the camera.
-      cameraX = CAMERA_START_X * SCALE_FACTOR;
-      cameraY = CAMERA_START_Y * SCALE_FACTOR;
-      cameraZ = CAMERA_START_Z * SCALE_FACTOR;
-      cameraR = CAMERA_START_R;
+      camera.x = CAMERA_START_X * SCALE_FACTOR;
+      camera.y = CAMERA_START_Y * SCALE_FACTOR;
+      camera.z = CAMERA_START_Z * SCALE_FACTOR;
+      camera.r = CAMERA_START_R;
 
       momentum = CAMERA_START_MOMENTUM * SCALE_FACTOR;
       rotationDirection  = 0;
@@ -684,13 +1573,10 @@ void keyDown(unsigned char key, int x, int y) {
       momentum = 0;
 
       //Set frame.
-      frame = 605;
+      frame = viewpoints[0].frame;
 
       //Move the camera.
-      cameraX = 0.004524;
-      cameraY = 0.000052;
-      cameraZ = 0.007764;
-      cameraR = 306;
+      camera = viewpoints[0].camera;
 
       //Reset animation object positions and rotations.
       planePriorX = 0, planePriorY = -0.871533, planePriorZ = -1.577791;
@@ -709,13 +1595,10 @@ void keyDown(unsigned char key, int x, int y) {
       momentum = 0;
 
       //Set frame.
-      frame = 224;
+      frame = viewpoints[2].frame;
 
       //Move the camera.
-      cameraX = 0.001829;
-      cameraY = -0.000004;
-      cameraZ = 0.00298;
-      cameraR = 138;
+      camera = viewpoints[2].camera;
 
       //Reset animation object positions and rotations.
       planePriorX = 0, planePriorY = 0, planePriorZ = 0;
@@ -734,13 +1617,10 @@ void keyDown(unsigned char key, int x, int y) {
       momentum = 0;
 
       //Set frame.
-      frame = -1;
+      frame = viewpoints[1].frame;
 
       //Move the camera.
-      cameraX = 0.000094;
-      cameraY = -0.000036;
-      cameraZ = -0.000103;
-      cameraR = 42;
+      camera = viewpoints[1].camera;
 
       //Reset animation object positions and rotations.
       planePriorX = 0, planePriorY = 0, planePriorZ = 0;
@@ -752,8 +1632,10 @@ void keyDown(unsigned char key, int x, int y) {
       eagleRotX = 0, eagleRotY = 0, eagleRotZ = 0;
     break;
 
+    case 'v': splitScreen = !splitScreen; break;
+
     case 'h':
-      printf("\n\n*** Controls ***\n\nW: Accelerate\nS: Decelerate\nA: Turn left\nD: Turn right\n=: Increase elevation\n-: Decrease elevation\n0: Stop moving\nSpace: Pause animation\n\nF: Fullscreen\nP: Set viewpoint A\nU: Set viewpoint B\nY: Set viewpoint C\n\nH: Help\nR: Reset\nQ: Quit");
+      printf("\n\n*** Controls ***\n\nW: Accelerate\nS: Decelerate\nA: Turn left\nD: Turn right\n=: Increase elevation\n-: Decrease elevation\n0: Stop moving\nSpace: Pause animation\n\nF: Fullscreen\nP: Set viewpoint A\nU: Set viewpoint B\nY: Set viewpoint C\nV: Split screen\n\nH: Help\nR: Reset\nQ: Quit");
     break;
 
     case 'f':
@@ -785,14 +1667,33 @@ void keyUp(unsigned char key, int x, int y) {
   }
 }
 
+//Keyboard input is recorded, or ignored while a flight is replayed.
+void liveKeyDown(unsigned char key, int x, int y) {
+  if (replayFile) {
+    if (key == 'q') finishReplay();
+    return;
+  }
+
+  //Quitting ends the recording, so it is not recorded itself.
+  if (key != 'q') recordEvent(EVENT_KEY_DOWN, key);
+  keyDown(key, x, y);
+}
+
+void liveKeyUp(unsigned char key, int x, int y) {
+  if (replayFile) return;
+
+  recordEvent(EVENT_KEY_UP, key);
+  keyUp(key, x, y);
+}
+
 //Entry point.
 int main(int argc, char **argv) {
   init(argc, argv);
   glutDisplayFunc(display);
   glutTimerFunc(1000 / 60, timer, 0);
   glutSetKeyRepeat(0);
-  glutKeyboardFunc(keyDown);
-  glutKeyboardUpFunc(keyUp);
+  glutKeyboardFunc(liveKeyDown);
+  glutKeyboardUpFunc(liveKeyUp);
   glutReshapeFunc(reshape);
   glutMainLoop();
 